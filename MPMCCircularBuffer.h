@@ -0,0 +1,203 @@
+#pragma once
+
+/// @file MPMCCircularBuffer.h
+/// Contains a utility class that implements a lock-free, multi-producer,
+/// multi-consumer circular buffer of fixed-size records.
+///
+/// @author Bob Hood
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "CircularBuffer.h"
+
+/// @class MPMCCircularBuffer
+/// @brief Lock-free bounded queue for many producers and many consumers
+///
+/// Each Unit is treated as one record.  Every slot carries a sequence
+/// number (after Dmitry Vyukov's bounded MPMC queue) that tells producers
+/// and consumers, without any shared lock, whether the slot is free for the
+/// current lap or holds a record that is ready to be read.
+///
+/// insert_units() and extract_units() move a run of records as a group: a
+/// producer claims the whole run with a single compare-and-swap, so the
+/// records of one call stay contiguous and in order, and the call either
+/// moves every record or none of them.
+///
+/// The capacity is rounded up to a power of two.
+
+template <typename Unit>
+class MPMCCircularBuffer
+{
+public:
+	MPMCCircularBuffer(int unit_count = 0)
+	{
+		if (unit_count <= 0)
+			return;
+
+		std::size_t slot_count = 1;
+		while (slot_count < static_cast<std::size_t>(unit_count))
+			slot_count <<= 1;
+
+		m_slots = SlotPtr(new Slot[slot_count]);
+		m_slot_mask = slot_count - 1;
+		m_unit_count = static_cast<int>(slot_count);
+
+		// slot i is free for the producer of position i
+		for (std::size_t i = 0; i < slot_count; ++i)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	MPMCCircularBuffer(const MPMCCircularBuffer&) = delete;
+	MPMCCircularBuffer& operator=(const MPMCCircularBuffer&) = delete;
+
+	/*!
+	Insert data units into the circular buffer.  Safe to call from any number of threads.
+
+	\param data A pointer to the buffer holding an array of one or more units to place.
+	\param unit_count The number of units from the data buffer to place.
+	\return A Boolean that indicates the data was successfully inserted.  A false return means the data would not fit.
+	*/
+	bool insert_units(const Unit* data, int unit_count) noexcept
+	{
+		if (!m_unit_count || unit_count > m_unit_count)
+			return false;
+		if (unit_count <= 0)
+			return true;
+
+		auto count = static_cast<std::size_t>(unit_count);
+		auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			// if the last slot of the run has been released by its consumer, every
+			// earlier slot has at least been claimed by one, so the run is ours to take
+			auto& last = m_slots[(pos + count - 1) & m_slot_mask];
+			auto diff = static_cast<std::intptr_t>(last.sequence.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos + count - 1);
+			if (diff == 0)
+			{
+				if (m_enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false; // full
+			else
+				pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		}
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto& slot = m_slots[(pos + i) & m_slot_mask];
+			wait_for(slot, pos + i);
+			slot.unit = data[i];
+			slot.sequence.store(pos + i + 1, std::memory_order_release);
+		}
+
+		return true;
+	}
+
+	/*!
+	Extract data units from the circular buffer.  Safe to call from any number of threads.
+
+	\param data A pointer to the buffer to receive the data units extracted.
+	\param unit_count The number of units to extract from the circular buffer.
+	\return A Boolean that indicates the data was successfully extracted.  A false return means there weren't enough data units available to satisfy the request.
+	*/
+	bool extract_units(Unit* data, int unit_count) noexcept
+	{
+		if (!m_unit_count || unit_count > m_unit_count)
+			return false;
+		if (unit_count <= 0)
+			return true;
+
+		auto count = static_cast<std::size_t>(unit_count);
+		auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			// if the last slot of the run has been filled, every earlier slot
+			// has at least been claimed by a producer
+			auto& last = m_slots[(pos + count - 1) & m_slot_mask];
+			auto diff = static_cast<std::intptr_t>(last.sequence.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos + count);
+			if (diff == 0)
+			{
+				if (m_dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false; // not enough data
+			else
+				pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		}
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto& slot = m_slots[(pos + i) & m_slot_mask];
+			wait_for(slot, pos + i + 1);
+			data[i] = slot.unit;
+			// free the slot for the producer one lap ahead
+			slot.sequence.store(pos + i + m_slot_mask + 1, std::memory_order_release);
+		}
+
+		return true;
+	}
+
+	/*!
+	Reports the maximum number of data units the circular buffer can hold.
+
+	\return An integer count of the number of data units.
+	*/
+	int capacity() const noexcept { return m_unit_count; }
+
+	/*!
+	Reports approximately how many data units are currently being held by the circular buffer.
+	Runs claimed by producers or consumers that are still copying are counted as complete.
+
+	\return An integer count of the number of data units.
+	*/
+	int used_space() const noexcept
+	{
+		auto tail = m_dequeue_pos.load(std::memory_order_acquire);
+		auto head = m_enqueue_pos.load(std::memory_order_acquire);
+		auto used = static_cast<std::intptr_t>(head - tail);
+		if (used < 0)
+			return 0;
+		return (used > m_unit_count) ? m_unit_count : static_cast<int>(used);
+	}
+
+	/*!
+	Reports approximately how many empty data unit slots are currently available in the circular buffer.
+	This is simply the inverse of the used space.
+
+	\return An integer count of the number of unused data units available.
+	*/
+	int free_space() const noexcept { return m_unit_count - used_space(); }
+
+protected: // aliases and enums
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence{0};
+		Unit unit{};
+	};
+
+	using SlotPtr = std::unique_ptr<Slot[]>;
+
+protected: // methods
+	// waits out a peer that claimed the slot earlier and is still copying
+	static void wait_for(const Slot& slot, std::size_t sequence) noexcept
+	{
+		while (slot.sequence.load(std::memory_order_acquire) != sequence)
+			std::this_thread::yield();
+	}
+
+protected: // data members
+	SlotPtr m_slots;
+	std::size_t m_slot_mask{0};
+	int m_unit_count{0};
+
+	// producers and consumers each get their own cache line
+	alignas(buffer_cache_line_size) std::atomic<std::size_t> m_enqueue_pos{0};
+	alignas(buffer_cache_line_size) std::atomic<std::size_t> m_dequeue_pos{0};
+	char m_padding[buffer_cache_line_size - sizeof(std::atomic<std::size_t>)];
+};
@@ -0,0 +1,534 @@
+#pragma once
+
+/// @file MappedCircularBuffer.h
+/// Contains a utility class that implements a single-producer, single-consumer
+/// circular buffer whose storage and positions live in a memory-mapped file
+/// or in shared memory.
+///
+/// @author Bob Hood
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#	define CIRCULARBUFFER_MAPPED_FILES
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#	include <sys/sysctl.h> // KERN_BOOTTIME
+#endif
+
+#include "CircularBuffer.h"
+
+/// @class MappedCircularBuffer
+/// @brief A lock-free SPSC circular buffer that outlives, or is shared between, processes
+///
+/// The file holds a versioned control block (holding the head and tail
+/// positions) on its first page, followed by the units themselves.  Nothing
+/// in the file is a pointer: the storage is found through an offset recorded
+/// in the control block, so any process can map it at any address.
+///
+/// Everything inserted is in the shared page cache the moment insert_units()
+/// returns, so it survives the process dying, and reopening the file picks up
+/// exactly where the ring left off.  The live head, though, can reach the disk
+/// before the data it covers (the kernel writes pages back in any order), so
+/// it cannot be trusted after the machine goes down.  To survive that too,
+/// call flush(true) every so often: it msync()s only the units written since
+/// the previous flush, and once they are on disk it records the head in a
+/// separate durable head.  When a file is reopened after the system has
+/// restarted, the ring resumes from the durable head, and units inserted
+/// since the last flush are lost.  The tail on disk can lag, so the consumer
+/// may see a few units again.  (Where the platform cannot tell that it has
+/// restarted, every reopen resumes from the durable head.)
+///
+/// open_shared() places the same layout in POSIX shared memory instead, so
+/// the producer and consumer can be in different processes.
+///
+/// The capacity is rounded up to a power of two, and Unit must be trivially
+/// copyable.  Only POSIX systems are supported; elsewhere open_file() and
+/// open_shared() fail.
+
+template <typename Unit>
+class MappedCircularBuffer
+{
+	static_assert(std::is_trivially_copyable<Unit>::value, "MappedCircularBuffer requires a trivially-copyable Unit");
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "MappedCircularBuffer requires lock-free 64-bit atomics");
+
+public:
+	MappedCircularBuffer() = default;
+	MappedCircularBuffer(const MappedCircularBuffer&) = delete;
+	MappedCircularBuffer& operator=(const MappedCircularBuffer&) = delete;
+	~MappedCircularBuffer() { close(); }
+
+	/*!
+	Map a ring file, creating and initializing it if it does not exist (or was never
+	completely initialized).  An existing ring keeps its contents and positions.
+
+	\param path The file to map.
+	\param unit_count The number of units a new ring should hold, rounded up to a power of two.
+	An existing ring must have been created with the same (rounded) count, unless this is zero.
+	\return A Boolean that indicates the ring was mapped.  A false return means the file could
+	not be opened or mapped, or holds a ring of a different version, Unit size or capacity.
+	*/
+	bool open_file(const char* path, int unit_count) noexcept
+	{
+		close();
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+		auto fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+		auto requested = requested_units(unit_count);
+		auto attached = attach_existing(fd, requested, true);
+		auto mapped = (attached == Attach::Mapped) || (attached == Attach::Uninitialized && create_ring(fd, requested));
+		::close(fd);
+		return mapped;
+#else
+		(void)path;
+		(void)unit_count;
+		return false;
+#endif
+	}
+
+	/*!
+	Map a ring in POSIX shared memory (see shm_open()), so that a producer in one process and
+	a consumer in another can exchange data with plain loads, stores and memcpy(), and no
+	system calls at all on the fast path.  The first process to open the name creates the
+	ring; the others attach to it, waiting up to a second for the creator to finish setting
+	it up.  The ring lasts until remove_shared() is called or the system restarts.
+
+	\note Both processes must use the same Unit, and the same build of this header.
+
+	\param name The name of the shared memory object; portable names start with '/'.
+	\param unit_count The number of units a new ring should hold, rounded up to a power of two.
+	An existing ring must have been created with the same (rounded) count, unless this is zero.
+	\return A Boolean that indicates the ring was mapped.  A false return means the object could
+	not be created, opened or mapped, or holds a ring of a different version, Unit size or capacity.
+	*/
+	bool open_shared(const char* name, int unit_count) noexcept
+	{
+		close();
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+		auto requested = requested_units(unit_count);
+		auto fd = requested ? ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+		if (fd >= 0)
+		{
+			auto mapped = create_ring(fd, requested);
+			::close(fd);
+			if (!mapped)
+				::shm_unlink(name);
+			return mapped;
+		}
+
+		fd = ::shm_open(name, O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+
+		// the creator sizes the object and then publishes the magic number last
+		auto attached = attach_existing(fd, requested, false);
+		for (auto attempt = 0; attached == Attach::Uninitialized && attempt < 1000; ++attempt)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			attached = attach_existing(fd, requested, false);
+		}
+		::close(fd);
+		return attached == Attach::Mapped;
+#else
+		(void)name;
+		(void)unit_count;
+		return false;
+#endif
+	}
+
+	/*!
+	Remove a shared memory ring's name.  Processes that have it mapped keep using it; the
+	memory is released when the last of them closes it.
+
+	\param name The name passed to open_shared().
+	\return A Boolean that indicates the name was removed.
+	*/
+	static bool remove_shared(const char* name) noexcept
+	{
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+		return ::shm_unlink(name) == 0;
+#else
+		(void)name;
+		return false;
+#endif
+	}
+
+	/*!
+	Unmap the ring.  The file, and everything in it, is left in place.
+	*/
+	void close() noexcept
+	{
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+		if (m_base)
+			::munmap(m_base, m_mapped_size);
+#endif
+		m_base = nullptr;
+		m_control = nullptr;
+		m_storage = nullptr;
+		m_mapped_size = 0;
+		m_unit_count = 0;
+	}
+
+	bool is_open() const noexcept { return m_base != nullptr; }
+
+	/*!
+	Insert data units into the ring.  Only the producer may call this.
+
+	\param data A pointer to the buffer holding an array of one or more units to place.
+	\param unit_count The number of units from the data buffer to place.
+	\return A Boolean that indicates the data was successfully inserted.  A false return means the data would not fit.
+	*/
+	bool insert_units(const Unit* data, int unit_count) noexcept
+	{
+		if (!m_control || unit_count < 0 || static_cast<std::uint64_t>(unit_count) > m_unit_count)
+			return false;
+		if (!unit_count)
+			return true;
+
+		auto count = static_cast<std::uint64_t>(unit_count);
+		auto head = m_control->head.load(std::memory_order_relaxed);
+		if (m_unit_count - (head - m_cached_tail) < count)
+		{
+			m_cached_tail = m_control->tail.load(std::memory_order_acquire);
+			if (m_unit_count - (head - m_cached_tail) < count)
+				return false;
+		}
+
+		auto index = head & (m_unit_count - 1);
+		auto first = (m_unit_count - index < count) ? m_unit_count - index : count;
+		::memcpy(m_storage + index, data, first * sizeof(Unit));
+		if (first < count)
+			::memcpy(m_storage, data + first, (count - first) * sizeof(Unit));
+
+		m_control->head.store(head + count, std::memory_order_release);
+		return true;
+	}
+
+	/*!
+	Extract data units from the ring.  Only the consumer may call this.
+
+	\param data A pointer to the buffer to receive the data units extracted.
+	\param unit_count The number of units to extract from the ring.
+	\return A Boolean that indicates the data was successfully extracted.  A false return means there weren't enough data units available to satisfy the request.
+	*/
+	bool extract_units(Unit* data, int unit_count) noexcept
+	{
+		if (!m_control || unit_count < 0)
+			return false;
+		if (!unit_count)
+			return true;
+
+		auto count = static_cast<std::uint64_t>(unit_count);
+		auto tail = m_control->tail.load(std::memory_order_relaxed);
+		if (m_cached_head - tail < count)
+		{
+			m_cached_head = m_control->head.load(std::memory_order_acquire);
+			if (m_cached_head - tail < count)
+				return false;
+		}
+
+		auto index = tail & (m_unit_count - 1);
+		auto first = (m_unit_count - index < count) ? m_unit_count - index : count;
+		::memcpy(data, m_storage + index, first * sizeof(Unit));
+		if (first < count)
+			::memcpy(data + first, m_storage, (count - first) * sizeof(Unit));
+
+		m_control->tail.store(tail + count, std::memory_order_release);
+		return true;
+	}
+
+	/*!
+	Write the units inserted since the last waiting flush(), and then the positions, back to
+	the file.  Call it from the producer (or while the producer is idle), as often as the data
+	is worth: each call costs two or three msync() calls covering only the dirty pages.
+
+	\param wait Whether to wait for the writes to complete (MS_SYNC) or only schedule them
+	(MS_ASYNC).  Only a waiting flush advances the durable head, because only then is the
+	data known to be on disk; after a system crash the ring resumes from there.
+	\return A Boolean that indicates the writes were issued (and, when waiting, completed).  A
+	false return means msync() failed, or the ring is not open.
+	*/
+	bool flush(bool wait = true) noexcept
+	{
+		if (!m_control)
+			return false;
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+		auto flags = wait ? MS_SYNC : MS_ASYNC;
+		auto head = m_control->head.load(std::memory_order_acquire);
+		auto dirty = head - m_flushed_head;
+		if (dirty > m_unit_count)
+			dirty = m_unit_count;
+
+		auto synced = true;
+		if (dirty)
+		{
+			auto index = (head - dirty) & (m_unit_count - 1);
+			auto first = (m_unit_count - index < dirty) ? m_unit_count - index : dirty;
+			synced = sync_units(index, first, flags);
+			if (first < dirty)
+				synced = sync_units(0, dirty - first, flags) && synced;
+		}
+
+		// the durable head only ever covers data that has reached the disk.  The live head and
+		// tail may be written back at any moment, so their order here guarantees nothing.
+		if (wait && synced)
+			m_control->durable_head.store(head, std::memory_order_relaxed);
+		synced = (::msync(m_base, m_storage_offset, flags) == 0) && synced;
+		if (wait && synced)
+			m_flushed_head = head;
+		return synced;
+#else
+		(void)wait;
+		return false;
+#endif
+	}
+
+	/*!
+	Reports the maximum number of data units the ring can hold.
+
+	\return An integer count of the number of data units.
+	*/
+	int capacity() const noexcept { return static_cast<int>(m_unit_count); }
+
+	/*!
+	Reports how many data units are currently being held by the ring.  As with
+	CircularBuffer::used_space() in BufferMode::SPSC, each side can rely on its own reading;
+	to anyone else it is a hint.
+
+	\return An integer count of the number of data units.
+	*/
+	int used_space() const noexcept
+	{
+		if (!m_control)
+			return 0;
+		auto tail = m_control->tail.load(std::memory_order_acquire);
+		auto used = m_control->head.load(std::memory_order_acquire) - tail;
+		return static_cast<int>((used > m_unit_count) ? m_unit_count : used);
+	}
+
+	/*!
+	Reports how many empty data unit slots are currently available in the ring.
+	This is simply the inverse of the used space.
+
+	\return An integer count of the number of unused data units available.
+	*/
+	int free_space() const noexcept { return capacity() - used_space(); }
+
+protected: // aliases and enums
+	enum class Attach
+	{
+		Mapped,
+		// the file is empty, or its creator has not finished initializing it
+		Uninitialized,
+		Failed,
+	};
+
+	static constexpr std::uint64_t ring_magic = 0x474E495246554243ull; // "CBUFRING"
+	static constexpr std::uint32_t ring_version = 2;
+
+	// the first page of the file.  Only fixed-width fields and offsets, so the layout is the
+	// same in every process that maps it.
+	struct ControlBlock
+	{
+		// written last when a ring is created, so a half-initialized file is recognized
+		std::atomic<std::uint64_t> magic;
+		std::uint32_t version;
+		std::uint32_t unit_size;
+		std::uint64_t unit_count;
+		// from the start of the file to the first unit
+		std::uint64_t storage_offset;
+		// the boot of the system that last mapped the ring (see current_boot_id())
+		std::atomic<std::uint64_t> boot_id;
+
+		alignas(buffer_cache_line_size) std::atomic<std::uint64_t> head;
+		// the head as of the last waiting flush(), whose units are all on disk
+		std::atomic<std::uint64_t> durable_head;
+		alignas(buffer_cache_line_size) std::atomic<std::uint64_t> tail;
+	};
+
+protected: // methods
+	static std::uint64_t round_up_pow2(std::uint64_t count) noexcept
+	{
+		std::uint64_t rounded = 1;
+		while (rounded < count)
+			rounded <<= 1;
+		return rounded;
+	}
+
+#if defined(CIRCULARBUFFER_MAPPED_FILES)
+	static std::uint64_t requested_units(int unit_count) noexcept { return (unit_count > 0) ? round_up_pow2(static_cast<std::uint64_t>(unit_count)) : 0; }
+
+	// the control block gets whole pages to itself, so flushing it never touches the data
+	static std::uint64_t storage_offset_for() noexcept
+	{
+		auto page_size = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+		return ((sizeof(ControlBlock) + page_size - 1) / page_size) * page_size;
+	}
+
+	// maps the ring already held by fd.  requested, when non-zero, is the capacity it must have.
+	// recover is set for files, which may have outlived a system crash.
+	Attach attach_existing(int fd, std::uint64_t requested, bool recover) noexcept
+	{
+		auto storage_offset = storage_offset_for();
+
+		struct stat info;
+		if (::fstat(fd, &info) != 0)
+			return Attach::Failed;
+		auto file_size = static_cast<std::uint64_t>(info.st_size);
+		if (file_size < storage_offset)
+			return Attach::Uninitialized;
+
+		auto header = ::mmap(nullptr, storage_offset, PROT_READ, MAP_SHARED, fd, 0);
+		if (header == MAP_FAILED)
+			return Attach::Failed;
+		auto existing = static_cast<const ControlBlock*>(header);
+		auto existing_magic = existing->magic.load(std::memory_order_acquire);
+		auto existing_count = existing->unit_count;
+		auto compatible = (existing->version == ring_version && existing->unit_size == sizeof(Unit) &&
+			existing->storage_offset == storage_offset && existing_count && !(existing_count & (existing_count - 1)) &&
+			file_size >= storage_offset + existing_count * sizeof(Unit) && (!requested || requested == existing_count));
+		::munmap(header, storage_offset);
+
+		if (!existing_magic)
+			return Attach::Uninitialized;
+		if (existing_magic != ring_magic || !compatible)
+			return Attach::Failed; // not one of ours, or not one we can use; leave it alone
+		return map_ring(fd, storage_offset, existing_count, false, recover) ? Attach::Mapped : Attach::Failed;
+	}
+
+	// sizes fd for a new ring of unit_count units and initializes it
+	bool create_ring(int fd, std::uint64_t unit_count) noexcept
+	{
+		if (!unit_count)
+			return false;
+		auto storage_offset = storage_offset_for();
+		if (::ftruncate(fd, static_cast<off_t>(storage_offset + unit_count * sizeof(Unit))) != 0)
+			return false;
+		return map_ring(fd, storage_offset, unit_count, true, false);
+	}
+
+	// identifies the current boot of the system, so that a reopened file can tell whether the
+	// machine has gone down since it was last mapped; 0 where the platform cannot say
+	static std::uint64_t current_boot_id() noexcept
+	{
+		std::uint64_t id{0};
+#if defined(__linux__)
+		char text[64];
+		auto fd = ::open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			auto length = ::read(fd, text, sizeof(text));
+			::close(fd);
+			if (length > 0)
+			{
+				// FNV-1a over the UUID text
+				id = 0xCBF29CE484222325ull;
+				for (decltype(length) i = 0; i < length; ++i)
+					id = (id ^ static_cast<unsigned char>(text[i])) * 0x100000001B3ull;
+			}
+		}
+#elif defined(KERN_BOOTTIME)
+		struct timeval boot_time;
+		auto size = sizeof(boot_time);
+		int name[2] = {CTL_KERN, KERN_BOOTTIME};
+		if (::sysctl(name, 2, &boot_time, &size, nullptr, 0) == 0)
+			id = static_cast<std::uint64_t>(boot_time.tv_sec) * 1000000u + static_cast<std::uint64_t>(boot_time.tv_usec);
+#endif
+		return id;
+	}
+
+	bool map_ring(int fd, std::uint64_t storage_offset, std::uint64_t unit_count, bool initialize, bool recover) noexcept
+	{
+		auto size = static_cast<std::size_t>(storage_offset + unit_count * sizeof(Unit));
+		auto base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			return false;
+
+		auto control = static_cast<ControlBlock*>(base);
+		if (initialize)
+		{
+			control->version = ring_version;
+			control->unit_size = sizeof(Unit);
+			control->unit_count = unit_count;
+			control->storage_offset = storage_offset;
+			control->boot_id.store(current_boot_id(), std::memory_order_relaxed);
+			control->head.store(0, std::memory_order_relaxed);
+			control->durable_head.store(0, std::memory_order_relaxed);
+			control->tail.store(0, std::memory_order_relaxed);
+			control->magic.store(ring_magic, std::memory_order_release);
+		}
+		else
+		{
+			auto head = control->head.load(std::memory_order_acquire);
+			auto tail = control->tail.load(std::memory_order_acquire);
+			auto durable_head = control->durable_head.load(std::memory_order_relaxed);
+			if (head - tail > unit_count || durable_head > head)
+			{
+				::munmap(base, size);
+				return false; // positions are corrupt
+			}
+
+			auto boot_id = current_boot_id();
+			if (recover && (!boot_id || control->boot_id.load(std::memory_order_relaxed) != boot_id))
+			{
+				// the system may have gone down since the ring was last mapped, so only units
+				// covered by the durable head are known to be on disk.  The tail on disk may be
+				// past it, if the consumer took units that were never flushed.
+				head = (durable_head > tail) ? durable_head : tail;
+				control->head.store(head, std::memory_order_relaxed);
+				control->durable_head.store(head, std::memory_order_relaxed);
+				control->boot_id.store(boot_id, std::memory_order_relaxed);
+			}
+		}
+
+		m_base = static_cast<char*>(base);
+		m_mapped_size = size;
+		m_control = control;
+		m_storage = reinterpret_cast<Unit*>(m_base + storage_offset);
+		m_storage_offset = static_cast<std::size_t>(storage_offset);
+		m_unit_count = unit_count;
+		m_cached_tail = control->tail.load(std::memory_order_acquire);
+		m_cached_head = control->head.load(std::memory_order_acquire);
+		// units written since the last waiting flush(), by whichever process, are still dirty
+		m_flushed_head = control->durable_head.load(std::memory_order_relaxed);
+		return true;
+	}
+
+	// msync()s the pages holding unit_count units from index
+	bool sync_units(std::uint64_t index, std::uint64_t unit_count, int flags) noexcept
+	{
+		auto page_size = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+		auto start = reinterpret_cast<std::uintptr_t>(m_storage + index);
+		auto end = reinterpret_cast<std::uintptr_t>(m_storage + index + unit_count);
+		start &= ~(page_size - 1);
+		return ::msync(reinterpret_cast<void*>(start), end - start, flags) == 0;
+	}
+#endif
+
+protected: // data members
+	char* m_base{nullptr};
+	std::size_t m_mapped_size{0};
+	std::size_t m_storage_offset{0};
+	ControlBlock* m_control{nullptr};
+	Unit* m_storage{nullptr};
+	std::uint64_t m_unit_count{0};
+
+	// the producer's state: its last-seen copy of the tail, and the head at the last flush()
+	alignas(buffer_cache_line_size) std::uint64_t m_cached_tail{0};
+	std::uint64_t m_flushed_head{0};
+
+	// the consumer's last-seen copy of the head
+	alignas(buffer_cache_line_size) std::uint64_t m_cached_head{0};
+	char m_padding[buffer_cache_line_size - sizeof(std::uint64_t)];
+};
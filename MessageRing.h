@@ -0,0 +1,202 @@
+#pragma once
+
+/// @file MessageRing.h
+/// Contains a utility class that stores variable-length, length-prefixed
+/// messages in a CircularBuffer.
+///
+/// @author Bob Hood
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "CircularBuffer.h"
+
+/// @class MessageRing
+/// @brief A CircularBuffer of whole, variable-length records
+///
+/// Each message is stored as an 8-byte header followed by its payload,
+/// rounded up to a multiple of 8 bytes, so every header and payload is
+/// 8-byte aligned.  try_push() writes a record in place and publishes it
+/// with a single commit; the consumer either sees all of it or none of it.
+///
+/// A record never straddles the end of the storage.  When one would, the
+/// rest of the storage is filled with a padding record that front() skips,
+/// so front() always hands back a contiguous payload that can be read in
+/// place.  With BufferBacking::Mirrored no padding is ever needed.
+///
+/// The largest message that is always accepted by an empty ring is
+/// max_message_size() bytes.
+
+template <BufferMode Mode = BufferMode::SPSC>
+class MessageRing
+{
+public: // aliases and types
+	/// A read-only view of a message payload.  data is null when there is no message.
+	struct Message
+	{
+		const void* data{nullptr};
+		std::size_t size{0};
+
+		explicit operator bool() const noexcept { return data != nullptr; }
+	};
+
+public:
+	/*!
+	\param byte_count The number of bytes the ring can hold, headers and padding included.
+	It is rounded up to a multiple of 8.
+	\param backing How the storage is allocated (see BufferBacking).
+	*/
+	MessageRing(int byte_count = 0, BufferBacking backing = BufferBacking::Heap) :
+		m_ring(static_cast<int>(units_for(static_cast<std::size_t>(byte_count > 0 ? byte_count : 0))), backing)
+	{
+	}
+
+	MessageRing(const MessageRing&) = delete;
+	MessageRing& operator=(const MessageRing&) = delete;
+
+	/*!
+	Append a message to the ring.  Only the producer may call this.
+
+	\param message The payload to copy in.
+	\return A Boolean that indicates the message was stored.  A false return means the ring
+	does not currently have room for it (or it is larger than the ring could ever hold).
+	*/
+	bool try_push(const Message& message) noexcept { return try_push(message.data, message.size); }
+
+	/*!
+	Append a message to the ring.  Only the producer may call this.
+
+	\param data A pointer to the payload bytes.  It may be null if size is zero.
+	\param size The number of payload bytes.
+	\return A Boolean that indicates the message was stored.  A false return means the ring
+	does not currently have room for it (or it is larger than the ring could ever hold).
+	*/
+	bool try_push(const void* data, std::size_t size) noexcept
+	{
+		if (size > max_message_size())
+			return false;
+
+		auto units = static_cast<int>(1 + units_for(size));
+		auto spans = m_ring.reserve_write(units);
+		if (spans.count() < units)
+			return false;
+
+		int padding{0};
+		if (spans.first.count < units)
+		{
+			// the record would straddle the wrap, so pad out the rest of the storage and
+			// place it at the start instead
+			padding = spans.first.count;
+			spans = m_ring.reserve_write(padding + units);
+			if (spans.count() < padding + units)
+				return false;
+			write_header(spans.first.data, 0, static_cast<std::uint32_t>(padding));
+		}
+
+		auto* record = padding ? spans.second.data : spans.first.data;
+		write_header(record, static_cast<std::uint32_t>(size), 0);
+		if (size)
+			::memcpy(record + 1, data, size);
+		return m_ring.commit_write(padding + units);
+	}
+
+	/*!
+	Look at the oldest message in place, without copying it.  The payload stays valid until
+	pop() is called.  Only the consumer may call this.
+
+	\return A view of the payload, or an empty Message if the ring holds no messages.
+	*/
+	Message front() noexcept
+	{
+		for (;;)
+		{
+			auto spans = m_ring.peek_read(1);
+			if (!spans.count())
+				return {};
+
+			auto header = read_header(spans.first.data);
+			if (header.padding)
+			{
+				// a record never starts in the padding, so the next one is at the start of the storage
+				m_ring.consume(static_cast<int>(header.padding));
+				continue;
+			}
+
+			m_front_units = static_cast<int>(1 + units_for(header.size));
+			spans = m_ring.peek_read(m_front_units);
+			return {spans.first.data + 1, header.size};
+		}
+	}
+
+	/*!
+	Remove the oldest message.  Only the consumer may call this.
+
+	\return A Boolean that indicates a message was removed.  A false return means the ring was empty.
+	*/
+	bool pop() noexcept
+	{
+		if (!m_front_units && !front())
+			return false;
+
+		auto units = m_front_units;
+		m_front_units = 0;
+		return m_ring.consume(units);
+	}
+
+	/*!
+	Reports the number of bytes the ring can hold, headers and padding included.
+
+	\return An integer count of bytes.
+	*/
+	std::size_t capacity() const noexcept { return static_cast<std::size_t>(m_ring.capacity()) * sizeof(Slot); }
+
+	/*!
+	Reports the largest payload an empty ring will always accept.  Half the storage, less
+	a header, so that the record fits on one side of the wrap point wherever the ring is.
+
+	\return An integer count of bytes.
+	*/
+	std::size_t max_message_size() const noexcept
+	{
+		auto units = static_cast<std::size_t>(m_ring.capacity());
+		if (!m_ring.is_mirrored())
+			units /= 2;
+		return (units > 1) ? (units - 1) * sizeof(Slot) : 0;
+	}
+
+protected: // aliases and enums
+	// one 8-byte unit of storage
+	using Slot = std::uint64_t;
+
+	struct Header
+	{
+		// payload bytes that follow the header
+		std::uint32_t size;
+		// for a padding record, the number of units (this header included) to skip
+		std::uint32_t padding;
+	};
+
+	static_assert(sizeof(Header) == sizeof(Slot), "MessageRing headers must fill exactly one unit");
+
+protected: // methods
+	static constexpr std::size_t units_for(std::size_t size) noexcept { return (size + sizeof(Slot) - 1) / sizeof(Slot); }
+
+	static void write_header(Slot* slot, std::uint32_t size, std::uint32_t padding) noexcept
+	{
+		Header header{size, padding};
+		::memcpy(slot, &header, sizeof(header));
+	}
+
+	static Header read_header(const Slot* slot) noexcept
+	{
+		Header header;
+		::memcpy(&header, slot, sizeof(header));
+		return header;
+	}
+
+protected: // data members
+	CircularBuffer<Slot, Mode> m_ring;
+	// units of the record last returned by front(), released by pop(); consumer-owned
+	int m_front_units{0};
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+/// @file ShardedRing.h
+/// Contains a utility class that spreads many producers over per-producer
+/// SPSC circular buffers, drained by a pool of work-stealing consumers.
+///
+/// @author Bob Hood
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "CircularBuffer.h"
+
+/// @class ShardedRing
+/// @brief One SPSC CircularBuffer per producer, shared out among consumers
+///
+/// Every producer owns a shard, so producers never contend with each other
+/// and each insertion is a plain lock-free SPSC insert_units().  Each shard
+/// also has a home consumer (shard % consumer_count).  A consumer drains its
+/// home shards first, round robin, and only when all of them are empty does
+/// it steal from the busiest other shard, judged by the wait-free
+/// used_space().
+///
+/// A shard is only ever read by one consumer at a time: a consumer claims it
+/// with a flag before extracting, and skips it if another consumer holds it.
+/// That keeps each shard's single-consumer contract intact, and keeps the
+/// units of each producer in the order they were inserted.  Units taken in
+/// separate calls, by separate consumers, may of course be processed in
+/// either order; consumers that care can use the shard index they are given.
+
+template <typename Unit>
+class ShardedRing
+{
+public:
+	/*!
+	\param shard_count The number of producers, each with its own shard.
+	\param units_per_shard The number of units each shard can hold.
+	\param consumer_count The number of consumers that will drain the shards.
+	*/
+	ShardedRing(int shard_count, int units_per_shard, int consumer_count = 1) :
+		m_consumer_count((consumer_count > 0) ? consumer_count : 1)
+	{
+		for (auto i = 0; i < shard_count; ++i)
+			m_shards.push_back(std::make_unique<Shard>(units_per_shard));
+		m_consumers = std::make_unique<ConsumerState[]>(static_cast<std::size_t>(m_consumer_count));
+	}
+
+	ShardedRing(const ShardedRing&) = delete;
+	ShardedRing& operator=(const ShardedRing&) = delete;
+
+	/*!
+	Insert data units into a producer's shard.  Only that shard's producer may call this.
+
+	\param shard The producer's shard, from 0 to shard_count() - 1.
+	\param data A pointer to the buffer holding an array of one or more units to place.
+	\param unit_count The number of units from the data buffer to place.
+	\return A Boolean that indicates the data was successfully inserted.  A false return means the data would not fit.
+	*/
+	bool insert_units(int shard, const Unit* data, int unit_count) noexcept { return m_shards[static_cast<std::size_t>(shard)]->ring.insert_units(data, unit_count); }
+
+	/*!
+	Extract up to max_units units from a single shard: one of the consumer's home shards if
+	any holds data, otherwise the busiest shard another consumer is not reading.
+
+	\param consumer The calling consumer, from 0 to consumer_count() - 1.
+	\param data A pointer to the buffer to receive the data units extracted.
+	\param max_units The most units to extract.
+	\param shard If not null, receives the shard the units came from.
+	\return The number of units extracted, which is zero when every shard is empty (or busy).
+	*/
+	int extract_some(int consumer, Unit* data, int max_units, int* shard = nullptr) noexcept
+	{
+		return visit(consumer, [&](int index, CircularBuffer<Unit, BufferMode::SPSC>& ring) noexcept {
+			auto extracted = ring.extract_some(data, max_units);
+			if (extracted && shard)
+				*shard = index;
+			return extracted;
+		});
+	}
+
+	/*!
+	Hand up to max_units units from a single shard (chosen as extract_some() does) to fn in
+	place, as fn(int shard, const Unit* data, int unit_count), then release them all at once
+	(see CircularBuffer::drain()).
+
+	\param consumer The calling consumer, from 0 to consumer_count() - 1.
+	\param max_units The most units to drain.
+	\param fn The callable that examines each run.
+	\return The number of units drained, which is zero when every shard is empty (or busy).
+	*/
+	template <typename Fn>
+	int drain(int consumer, int max_units, Fn&& fn)
+	{
+		return visit(consumer, [&](int index, CircularBuffer<Unit, BufferMode::SPSC>& ring) {
+			return ring.drain(max_units, [&](const Unit* data, int unit_count) { fn(index, data, unit_count); });
+		});
+	}
+
+	int shard_count() const noexcept { return static_cast<int>(m_shards.size()); }
+	int consumer_count() const noexcept { return m_consumer_count; }
+
+	/*!
+	Reports approximately how many data units are held across all shards.
+
+	\return An integer count of the number of data units.
+	*/
+	int used_space() const noexcept
+	{
+		auto used = 0;
+		for (auto& shard : m_shards)
+			used += shard->ring.used_space();
+		return used;
+	}
+
+protected: // aliases and enums
+	struct Shard
+	{
+		explicit Shard(int unit_count) :
+			ring(unit_count)
+		{
+		}
+
+		CircularBuffer<Unit, BufferMode::SPSC> ring;
+		// held by the one consumer currently reading this shard
+		alignas(buffer_cache_line_size) std::atomic<bool> reading{false};
+	};
+
+	// releases a claimed shard when it leaves scope, even if the consumer's callable throws
+	class ShardClaim
+	{
+	public:
+		explicit ShardClaim(Shard& shard) noexcept :
+			m_shard(shard)
+		{
+		}
+		ShardClaim(const ShardClaim&) = delete;
+		ShardClaim& operator=(const ShardClaim&) = delete;
+		~ShardClaim() { release(m_shard); }
+
+	private:
+		Shard& m_shard;
+	};
+
+	// the home shard that a consumer tries first next time, on its own cache line
+	struct alignas(buffer_cache_line_size) ConsumerState
+	{
+		int next_home{0};
+	};
+
+protected: // methods
+	// claims a shard for the calling consumer; the acquire pairs with the previous reader's release
+	static bool try_claim(Shard& shard) noexcept
+	{
+		return !shard.reading.load(std::memory_order_relaxed) && !shard.reading.exchange(true, std::memory_order_acquire);
+	}
+
+	static void release(Shard& shard) noexcept { shard.reading.store(false, std::memory_order_release); }
+
+	// runs take on the first home shard with data, or else on the busiest shard that can be
+	// claimed, and returns its result
+	template <typename Take>
+	int visit(int consumer, Take&& take)
+	{
+		auto shard_count = static_cast<int>(m_shards.size());
+		auto& state = m_consumers[static_cast<std::size_t>(consumer)];
+
+		// home shards, continuing round robin from where we left off
+		auto homes = (shard_count > consumer) ? (shard_count - consumer + m_consumer_count - 1) / m_consumer_count : 0;
+		for (auto i = 0; i < homes; ++i)
+		{
+			auto home = (state.next_home + i) % homes;
+			auto index = consumer + home * m_consumer_count;
+			auto& shard = *m_shards[static_cast<std::size_t>(index)];
+			if (!shard.ring.used_space() || !try_claim(shard))
+				continue;
+			ShardClaim claim(shard);
+			auto taken = take(index, shard.ring);
+			if (taken)
+			{
+				state.next_home = (home + 1) % homes;
+				return taken;
+			}
+		}
+
+		// steal from whichever other shard holds the most
+		for (;;)
+		{
+			auto busiest = -1;
+			auto most = 0;
+			for (auto index = 0; index < shard_count; ++index)
+			{
+				auto& shard = *m_shards[static_cast<std::size_t>(index)];
+				if (index % m_consumer_count == consumer || shard.reading.load(std::memory_order_relaxed))
+					continue;
+				auto used = shard.ring.used_space();
+				if (used > most)
+				{
+					most = used;
+					busiest = index;
+				}
+			}
+			if (busiest < 0)
+				return 0;
+
+			auto& shard = *m_shards[static_cast<std::size_t>(busiest)];
+			if (!try_claim(shard))
+				continue; // another consumer got there first; look again
+			ShardClaim claim(shard);
+			return take(busiest, shard.ring);
+		}
+	}
+
+protected: // data members
+	std::vector<std::unique_ptr<Shard>> m_shards;
+	int m_consumer_count{1};
+	std::unique_ptr<ConsumerState[]> m_consumers;
+};
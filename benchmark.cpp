@@ -0,0 +1,488 @@
+/// @file benchmark.cpp
+/// Throughput and latency benchmarks for CircularBuffer and MPMCCircularBuffer.
+///
+/// Each benchmark reports operations/sec, bytes/sec, and the p50/p99 latency
+/// of a single insert_units()/extract_units() pair (or of a single call, for
+/// the threaded runs).  Transfer sizes come from a fixed-seed generator and
+/// are produced before timing starts, so runs are repeatable and the random
+/// number generator is never on the clock.
+///
+/// On Windows, compile with: cl /O2 /EHsc /std:c++17 benchmark.cpp
+/// On Linux, compile with: g++ -O2 -std=c++17 -pthread benchmark.cpp
+///
+/// Usage: benchmark [scale [hgrm_prefix]]
+///   scale multiplies the iteration counts (default 1).
+///   hgrm_prefix, when built with -DCIRCULARBUFFER_ENABLE_TRACING=1, writes each
+///   traced run's histograms to <hgrm_prefix>-<run>-<phase>.hgrm.
+///
+/// Built with -DCIRCULARBUFFER_ENABLE_TRACING=1, a "-- traced --" section splits
+/// the locked runs' time into waiting for the buffer lock and copying units.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CircularBuffer.h"
+#include "MPMCCircularBuffer.h"
+#include "ShardedRing.h"
+
+using Clock = std::chrono::steady_clock;
+
+/// A 16-byte record, standing in for a packet descriptor.
+struct Packet
+{
+	std::uint64_t sequence;
+	std::uint32_t length;
+	std::uint32_t flags;
+};
+
+struct Result
+{
+	std::string name;
+	double seconds{0.0};
+	std::uint64_t ops{0};
+	std::uint64_t bytes{0};
+	LatencyHistogram latency;
+};
+
+static void report(const Result& r)
+{
+	std::printf(
+		"%-44s %12.0f ops/s %10.1f MB/s   p50 %7llu ns   p99 %7llu ns\n",
+		r.name.c_str(),
+		static_cast<double>(r.ops) / r.seconds,
+		static_cast<double>(r.bytes) / r.seconds / (1024.0 * 1024.0),
+		static_cast<unsigned long long>(r.latency.percentile(50.0)),
+		static_cast<unsigned long long>(r.latency.percentile(99.0)));
+}
+
+static std::uint64_t elapsed_ns(Clock::time_point start)
+{
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+#if CIRCULARBUFFER_ENABLE_TRACING
+// ticks of buffer_trace_timestamp() per nanosecond, measured against the steady clock
+static double trace_ticks_per_ns()
+{
+	auto start = Clock::now();
+	auto ticks = buffer_trace_timestamp();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	return static_cast<double>(buffer_trace_timestamp() - ticks) / static_cast<double>(elapsed_ns(start));
+}
+
+// prints the lock-wait and copy breakdown recorded since the last buffer_trace_reset(), and
+// writes each histogram as an .hgrm file if hgrm_prefix is given
+static void report_trace(const std::string& name, double ticks_per_ns, const char* hgrm_prefix)
+{
+	auto trace = buffer_trace_snapshot();
+	auto row = [&](const char* phase, const LatencyHistogram& histogram) {
+		auto ns = [&](double p) { return static_cast<double>(histogram.percentile(p)) / ticks_per_ns; };
+		std::printf(
+			"  %-10s %12llu calls   p50 %7.0f ns   p99 %7.0f ns   p99.9 %7.0f ns\n",
+			phase,
+			static_cast<unsigned long long>(histogram.total()),
+			ns(50.0),
+			ns(99.0),
+			ns(99.9));
+
+		if (!hgrm_prefix)
+			return;
+		auto path = std::string(hgrm_prefix) + "-" + name + "-" + phase + ".hgrm";
+		std::replace_if(path.begin() + static_cast<std::ptrdiff_t>(std::strlen(hgrm_prefix)), path.end(), [](char c) { return c == ' ' || c == '/'; }, '_');
+		if (auto* file = std::fopen(path.c_str(), "w"))
+		{
+			std::fputs(histogram.percentile_distribution(ticks_per_ns).c_str(), file);
+			std::fclose(file);
+		}
+	};
+
+	std::printf("%s\n", name.c_str());
+	row("lock wait", trace.lock_wait);
+	row("copy in", trace.copy_in);
+	row("copy out", trace.copy_out);
+}
+#endif
+
+// transfer sizes from a fixed seed, so every run (and every buffer type) sees the same sequence
+static std::vector<int> make_sizes(std::size_t count, int min_size, int max_size)
+{
+	std::mt19937 gen(20240601u);
+	std::uniform_int_distribution<> dist(min_size, max_size);
+	std::vector<int> sizes(count);
+	for (auto& size : sizes)
+		size = dist(gen);
+	return sizes;
+}
+
+// Single-threaded insert-then-extract pairs.  Throughput is timed over the whole
+// loop; latency is sampled per pair in a second pass so the clock reads don't
+// distort the throughput figure.
+template <typename Buffer, typename Unit>
+static Result run_uncontended(const std::string& name, Buffer& cb, const std::vector<int>& sizes)
+{
+	auto max_size = *std::max_element(sizes.begin(), sizes.end());
+	std::vector<Unit> in(static_cast<std::size_t>(max_size));
+	std::vector<Unit> out(static_cast<std::size_t>(max_size));
+
+	Result r;
+	r.name = name;
+
+	auto start = Clock::now();
+	for (auto size : sizes)
+	{
+		cb.insert_units(in.data(), size);
+		cb.extract_units(out.data(), size);
+		r.bytes += static_cast<std::uint64_t>(size) * sizeof(Unit);
+	}
+	r.seconds = static_cast<double>(elapsed_ns(start)) / 1e9;
+	r.ops = sizes.size();
+
+	for (auto size : sizes)
+	{
+		auto op_start = Clock::now();
+		cb.insert_units(in.data(), size);
+		cb.extract_units(out.data(), size);
+		r.latency.record(elapsed_ns(op_start));
+	}
+
+	return r;
+}
+
+// Like run_uncontended(), but every payload is checksummed on the way in and on the way
+// out, either in separate passes or fused with the copies.
+template <typename Buffer>
+static Result run_checksummed(const std::string& name, Buffer& cb, const std::vector<int>& sizes, bool fused)
+{
+	auto max_size = *std::max_element(sizes.begin(), sizes.end());
+	std::vector<std::uint8_t> in(static_cast<std::size_t>(max_size), 0x5A);
+	std::vector<std::uint8_t> out(static_cast<std::size_t>(max_size));
+
+	Result r;
+	r.name = name;
+
+	std::uint32_t mismatches{0};
+	auto pair = [&](int size) {
+		std::uint32_t crc_in{0};
+		std::uint32_t crc_out{0};
+		if (fused)
+		{
+			cb.insert_units_crc(in.data(), size, crc_in);
+			cb.extract_units_crc(out.data(), size, crc_out);
+		}
+		else
+		{
+			crc_in = BufferCrc32::update(0, in.data(), static_cast<std::size_t>(size));
+			cb.insert_units(in.data(), size);
+			cb.extract_units(out.data(), size);
+			crc_out = BufferCrc32::update(0, out.data(), static_cast<std::size_t>(size));
+		}
+		mismatches += (crc_in != crc_out);
+	};
+
+	auto start = Clock::now();
+	for (auto size : sizes)
+	{
+		pair(size);
+		r.bytes += static_cast<std::uint64_t>(size);
+	}
+	r.seconds = static_cast<double>(elapsed_ns(start)) / 1e9;
+	r.ops = sizes.size();
+
+	for (auto size : sizes)
+	{
+		auto op_start = Clock::now();
+		pair(size);
+		r.latency.record(elapsed_ns(op_start));
+	}
+
+	if (mismatches)
+		r.name += " (CRC MISMATCH)";
+	return r;
+}
+
+// Fills the buffer with small records and empties it again, either one extract_units() call
+// per record or one drain() call for the lot, summing every byte either way.  Latency is the
+// time to empty a full buffer.
+template <typename Buffer>
+static Result run_drained(const std::string& name, Buffer& cb, int record, std::size_t rounds, bool drained)
+{
+	std::vector<std::uint8_t> in(static_cast<std::size_t>(record), 0x5A);
+	std::vector<std::uint8_t> out(static_cast<std::size_t>(record));
+	auto records = cb.capacity() / record;
+
+	Result r;
+	r.name = name;
+
+	std::uint64_t checksum{0};
+	auto elapsed = std::uint64_t{0};
+	for (std::size_t round = 0; round < rounds; ++round)
+	{
+		for (auto i = 0; i < records; ++i)
+			cb.insert_units(in.data(), record);
+
+		auto op_start = Clock::now();
+		if (drained)
+		{
+			cb.drain(records * record, [&](const std::uint8_t* data, int unit_count) {
+				for (auto i = 0; i < unit_count; ++i)
+					checksum += data[i];
+			});
+		}
+		else
+		{
+			for (auto i = 0; i < records; ++i)
+			{
+				cb.extract_units(out.data(), record);
+				for (auto unit : out)
+					checksum += unit;
+			}
+		}
+		auto ns = elapsed_ns(op_start);
+		elapsed += ns;
+		r.latency.record(ns);
+	}
+	r.seconds = static_cast<double>(elapsed) / 1e9;
+	r.ops = static_cast<std::uint64_t>(records) * rounds;
+	r.bytes = r.ops * static_cast<std::uint64_t>(record);
+
+	if (!checksum)
+		r.name += " (NO DATA)";
+	return r;
+}
+
+// Producer and consumer threads moving total_units through the buffer.
+// Latency is the time for a single successful insert_units() call on the producer.
+template <typename Buffer, typename Unit>
+static Result run_contended(const std::string& name, Buffer& cb, int producers, int consumers, int chunk, std::uint64_t total_units)
+{
+	Result r;
+	r.name = name;
+
+	auto per_producer = total_units / static_cast<std::uint64_t>(producers);
+	auto per_consumer = total_units / static_cast<std::uint64_t>(consumers);
+	std::vector<LatencyHistogram> latencies(static_cast<std::size_t>(producers));
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+	for (auto p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([&, p]() {
+			std::vector<Unit> in(static_cast<std::size_t>(chunk));
+			for (std::uint64_t sent = 0; sent < per_producer; sent += static_cast<std::uint64_t>(chunk))
+			{
+				auto op_start = Clock::now();
+				while (!cb.insert_units(in.data(), chunk))
+					std::this_thread::yield();
+				latencies[static_cast<std::size_t>(p)].record(elapsed_ns(op_start));
+			}
+		});
+	}
+	for (auto c = 0; c < consumers; ++c)
+	{
+		threads.emplace_back([&]() {
+			std::vector<Unit> out(static_cast<std::size_t>(chunk));
+			for (std::uint64_t received = 0; received < per_consumer; received += static_cast<std::uint64_t>(chunk))
+			{
+				while (!cb.extract_units(out.data(), chunk))
+					std::this_thread::yield();
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	r.seconds = static_cast<double>(elapsed_ns(start)) / 1e9;
+
+	r.ops = (per_producer / static_cast<std::uint64_t>(chunk)) * static_cast<std::uint64_t>(producers);
+	r.bytes = r.ops * static_cast<std::uint64_t>(chunk) * sizeof(Unit);
+	for (auto& latency : latencies)
+		r.latency.merge(latency);
+	return r;
+}
+
+// Like run_contended(), but each producer inserts into its own shard and the consumers take
+// whatever extract_some() finds, home shards first.
+template <typename Unit>
+static Result run_sharded(const std::string& name, int producers, int consumers, int chunk, std::uint64_t total_units)
+{
+	ShardedRing<Unit> ring(producers, 1 << 16, consumers);
+	Result r;
+	r.name = name;
+
+	auto per_producer = total_units / static_cast<std::uint64_t>(producers);
+	std::vector<LatencyHistogram> latencies(static_cast<std::size_t>(producers));
+	std::atomic<std::uint64_t> received{0};
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+	for (auto p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([&, p]() {
+			std::vector<Unit> in(static_cast<std::size_t>(chunk));
+			for (std::uint64_t sent = 0; sent < per_producer; sent += static_cast<std::uint64_t>(chunk))
+			{
+				auto op_start = Clock::now();
+				while (!ring.insert_units(p, in.data(), chunk))
+					std::this_thread::yield();
+				latencies[static_cast<std::size_t>(p)].record(elapsed_ns(op_start));
+			}
+		});
+	}
+	auto expected = per_producer * static_cast<std::uint64_t>(producers);
+	for (auto c = 0; c < consumers; ++c)
+	{
+		threads.emplace_back([&, c]() {
+			std::vector<Unit> out(static_cast<std::size_t>(chunk) * 4);
+			while (received.load(std::memory_order_relaxed) < expected)
+			{
+				auto extracted = ring.extract_some(c, out.data(), static_cast<int>(out.size()));
+				if (extracted)
+					received.fetch_add(static_cast<std::uint64_t>(extracted), std::memory_order_relaxed);
+				else
+					std::this_thread::yield();
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	r.seconds = static_cast<double>(elapsed_ns(start)) / 1e9;
+
+	r.ops = (per_producer / static_cast<std::uint64_t>(chunk)) * static_cast<std::uint64_t>(producers);
+	r.bytes = r.ops * static_cast<std::uint64_t>(chunk) * sizeof(Unit);
+	for (auto& latency : latencies)
+		r.latency.merge(latency);
+	return r;
+}
+
+template <typename Unit>
+static void run_transfer_suite(const char* unit_name, std::size_t iterations)
+{
+	constexpr int ring_units = 1 << 16;
+
+	for (auto chunk : {16, 256, 4096})
+	{
+		std::vector<int> sizes(iterations, chunk);
+
+		// a power-of-two chunk in a power-of-two ring never straddles the end of the storage
+		{
+			CircularBuffer<Unit, BufferMode::Locked, ring_units> cb;
+			report(run_uncontended<decltype(cb), Unit>(std::string("fixed ") + std::to_string(chunk) + " " + unit_name + " locked aligned", cb, sizes));
+		}
+		{
+			CircularBuffer<Unit, BufferMode::SPSC, ring_units> cb;
+			report(run_uncontended<decltype(cb), Unit>(std::string("fixed ") + std::to_string(chunk) + " " + unit_name + " spsc aligned", cb, sizes));
+		}
+
+		// a ring just short of two chunks makes almost every transfer wrap
+		{
+			CircularBuffer<Unit> cb(chunk * 2 - 1);
+			report(run_uncontended<decltype(cb), Unit>(std::string("fixed ") + std::to_string(chunk) + " " + unit_name + " locked wrapping", cb, sizes));
+		}
+		{
+			CircularBuffer<Unit, BufferMode::SPSC> cb(chunk * 2 - 2);
+			report(run_uncontended<decltype(cb), Unit>(std::string("fixed ") + std::to_string(chunk) + " " + unit_name + " spsc wrapping", cb, sizes));
+		}
+	}
+
+	auto sizes = make_sizes(iterations, 1, 8192);
+	{
+		CircularBuffer<Unit> cb(ring_units);
+		report(run_uncontended<decltype(cb), Unit>(std::string("random 1-8192 ") + unit_name + " locked", cb, sizes));
+	}
+	{
+		CircularBuffer<Unit, BufferMode::SPSC> cb(ring_units);
+		report(run_uncontended<decltype(cb), Unit>(std::string("random 1-8192 ") + unit_name + " spsc", cb, sizes));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t scale = (argc > 1) ? static_cast<std::size_t>(std::strtoul(argv[1], nullptr, 10)) : 1;
+	if (!scale)
+		scale = 1;
+
+	std::printf("-- uncontended --\n");
+	run_transfer_suite<std::uint8_t>("u8", 20000 * scale);
+	run_transfer_suite<std::uint32_t>("u32", 20000 * scale);
+	run_transfer_suite<Packet>("packet", 5000 * scale);
+
+	std::printf("-- checksummed --\n");
+	{
+		auto sizes = make_sizes(20000 * scale, 1, 8192);
+		CircularBuffer<std::uint8_t, BufferMode::SPSC> cb(1 << 16);
+		report(run_checksummed(std::string("random 1-8192 u8 spsc crc two-pass"), cb, sizes, false));
+		report(run_checksummed(std::string("random 1-8192 u8 spsc crc fused"), cb, sizes, true));
+	}
+
+	std::printf("-- drained --\n");
+	for (auto drained : {false, true})
+	{
+		CircularBuffer<std::uint8_t> cb(1 << 16);
+		report(run_drained(std::string("16-byte records u8 locked ") + (drained ? "drain" : "extract"), cb, 16, 200 * scale, drained));
+	}
+	for (auto drained : {false, true})
+	{
+		CircularBuffer<std::uint8_t, BufferMode::SPSC> cb(1 << 16);
+		report(run_drained(std::string("16-byte records u8 spsc ") + (drained ? "drain" : "extract"), cb, 16, 200 * scale, drained));
+	}
+
+	std::printf("-- contended --\n");
+	const std::uint64_t total = 4000000ull * scale;
+	{
+		CircularBuffer<std::uint8_t, BufferMode::SPSC> cb(1 << 16);
+		report(run_contended<decltype(cb), std::uint8_t>("spsc u8 1p/1c chunk 256", cb, 1, 1, 256, total));
+	}
+	{
+		CircularBuffer<std::uint8_t, BufferMode::Locked, 1 << 16> cb;
+		report(run_contended<decltype(cb), std::uint8_t>("locked u8 1p/1c chunk 256", cb, 1, 1, 256, total));
+	}
+	// multi-megabyte payloads read by another core, with and without streaming copies
+	for (auto streaming : {false, true})
+	{
+		CircularBuffer<std::uint8_t, BufferMode::SPSC> cb(1 << 23);
+		cb.set_streaming_threshold(streaming ? 1 << 17 : 0);
+		report(run_contended<decltype(cb), std::uint8_t>(std::string("spsc u8 1p/1c chunk 2M") + (streaming ? " streaming" : ""), cb, 1, 1, 1 << 21, total * 32));
+	}
+	{
+		CircularBuffer<Packet, BufferMode::Locked, 1 << 12> cb;
+		report(run_contended<decltype(cb), Packet>("locked packet 2p/2c chunk 1", cb, 2, 2, 1, total / 64));
+	}
+	{
+		MPMCCircularBuffer<Packet> cb(1 << 12);
+		report(run_contended<decltype(cb), Packet>("mpmc packet 2p/2c chunk 1", cb, 2, 2, 1, total / 64));
+	}
+	// per-producer shards scale with the core count; run it at several sizes to see how far
+	auto cores = static_cast<int>(std::thread::hardware_concurrency());
+	for (auto threads = 1; threads <= ((cores > 1) ? cores / 2 : 1); threads *= 2)
+	{
+		auto label = std::to_string(threads) + "p/" + std::to_string(threads) + "c";
+		report(run_sharded<std::uint8_t>("sharded u8 " + label + " chunk 256", threads, threads, 256, total * static_cast<std::uint64_t>(threads)));
+	}
+
+#if CIRCULARBUFFER_ENABLE_TRACING
+	std::printf("-- traced --\n");
+	auto hgrm_prefix = (argc > 2) ? argv[2] : nullptr;
+	auto ticks_per_ns = trace_ticks_per_ns();
+	{
+		CircularBuffer<std::uint8_t, BufferMode::Locked, 1 << 16> cb;
+		buffer_trace_reset();
+		report(run_contended<decltype(cb), std::uint8_t>("locked u8 1p/1c chunk 256", cb, 1, 1, 256, total));
+		report_trace("locked u8 1p/1c chunk 256", ticks_per_ns, hgrm_prefix);
+	}
+	{
+		CircularBuffer<Packet, BufferMode::Locked, 1 << 12> cb;
+		buffer_trace_reset();
+		report(run_contended<decltype(cb), Packet>("locked packet 2p/2c chunk 1", cb, 2, 2, 1, total / 64));
+		report_trace("locked packet 2p/2c chunk 1", ticks_per_ns, hgrm_prefix);
+	}
+#endif
+}
@@ -1,57 +1,20 @@
-#pragma once
-
-#include <array>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <deque>
 #include <random>
-#include <numeric>
 #include <functional>
+#include <vector>
 
 #include "CircularBuffer.h"
 
-// Generates a lookup table for the checksums of all 8-bit values.
-std::array<std::uint_fast32_t, 256> generate_crc_lookup_table() noexcept
-{
-	auto const reversed_polynomial = std::uint_fast32_t{0xEDB88320uL};
-
-	// This is a function object that calculates the checksum for a value,
-	// then increments the value, starting from zero.
-	struct byte_checksum
-	{
-		std::uint_fast32_t operator()() noexcept
-		{
-			auto checksum = static_cast<std::uint_fast32_t>(n++);
-
-			for (auto i = 0; i < 8; ++i)
-				checksum = (checksum >> 1) ^ ((checksum & 0x1u) ? reversed_polynomial : 0);
-
-			return checksum;
-		}
-
-		unsigned n = 0;
-	};
-
-	auto table = std::array<std::uint_fast32_t, 256>{};
-	std::generate(table.begin(), table.end(), byte_checksum{});
-
-	return table;
-}
-
-// Calculates the CRC for any sequence of values. (You could use type traits and
-// a static assert to ensure the values can be converted to 8 bits.)
-template <typename InputIterator>
-std::uint_fast32_t crc(InputIterator first, InputIterator last)
+// Calculates the CRC-32 of a run of bytes (slice-by-8, or the ARMv8 CRC32
+// instructions where available; see BufferCrc32 in CircularBuffer.h).
+std::uint32_t crc(const std::vector<uint8_t>& data, int amount) noexcept
 {
-	// Generate lookup table only on first use then cache it - this is thread-safe.
-	static auto const table = generate_crc_lookup_table();
-
-	// Calculate the checksum - make sure to clip to 32 bits, for systems that
-	// don't have a true (fast) 32-bit type.
-	return std::uint_fast32_t{0xFFFFFFFFuL} &
-		   ~std::accumulate(
-			   first, last, ~std::uint_fast32_t{0} & std::uint_fast32_t{0xFFFFFFFFuL}, [](std::uint_fast32_t checksum, std::uint_fast8_t value) {
-				   return table[(checksum ^ value) & 0xFFu] ^ (checksum >> 8);
-			   });
+	return BufferCrc32::update(0, data.data(), static_cast<std::size_t>(amount));
 }
 
 template <typename... Args>
@@ -97,20 +60,18 @@ double run_circular_buffer_test(CircularBuffer<uint8_t>& cb, std::size_t max_dat
 			}
 
 			// calculate the CRC of the initialized buffer chunk
-			auto i_start = std::begin(adding_buffer);
-			auto i_end = std::begin(adding_buffer);
-			for (auto i = 0; i < amount; ++i)
-				++i_end;
-			std::size_t h1 = ::crc(i_start, i_end);
+			std::size_t h1 = ::crc(adding_buffer, amount);
 
 			auto start = std::chrono::steady_clock::now();
 
-			// write the size of the random buffer data
-			cb.insert_units(reinterpret_cast<uint8_t*>(&amount), sizeof(amount));
-			// write the random buffer data
-			cb.insert_units(adding_buffer.data(), amount);
-			// write its CRC value
-			cb.insert_units(reinterpret_cast<uint8_t*>(&h1), sizeof(std::size_t));
+			// write the size of the random buffer data, the data itself, and its
+			// CRC value as a single record
+			const CircularBuffer<uint8_t>::Span<const uint8_t> record[] = {
+				{reinterpret_cast<uint8_t*>(&amount), sizeof(amount)},
+				{adding_buffer.data(), amount},
+				{reinterpret_cast<uint8_t*>(&h1), sizeof(std::size_t)},
+			};
+			cb.insert_units_v(record, 3);
 
 			auto diff = std::chrono::steady_clock::now() - start;
 			total_time += std::chrono::duration<double, std::milli>(diff).count();
@@ -132,11 +93,7 @@ double run_circular_buffer_test(CircularBuffer<uint8_t>& cb, std::size_t max_dat
 			total_time += std::chrono::duration<double, std::milli>(diff).count();
 
 			// calculate the CRC of the extracted buffer
-			auto i_start = std::begin(extraction_buffer);
-			auto i_end = std::begin(extraction_buffer);
-			for (auto i = 0; i < amount; ++i)
-				++i_end;
-			std::size_t h2 = ::crc(i_start, i_end);
+			std::size_t h2 = ::crc(extraction_buffer, amount);
 
 			assert(h1 == h2); // make sure data is extracted accurately
 		}
@@ -148,8 +105,299 @@ double run_circular_buffer_test(CircularBuffer<uint8_t>& cb, std::size_t max_dat
 	return total_time;
 }
 
+// What a buffer flavour supports beyond the basic operations, so the model check knows which
+// settings and operations to exercise on it.
+enum ModelFeature : unsigned
+{
+	model_overwrite = 1, // set_overwrite_oldest()
+	model_growth = 2, // set_growth_limit()
+	model_resize = 4, // reserve() and shrink_to_fit()
+};
+
+// Replays a stream of operations against a CircularBuffer and a std::deque reference
+// model, returning false at the first point where the two disagree.  Each pair of bytes
+// selects an operation and its size; sizes run up to just past the largest capacity the
+// buffer may reach, so small buffers are driven through every wrapped, full and empty state.
+// Each reset also picks, from the operation byte's high bits, whether the buffer overwrites
+// and whether it may grow, among the settings that Features allows.
+template <unsigned Features, typename Buffer>
+bool check_against_model(Buffer& cb, const uint8_t* ops, std::size_t size)
+{
+	std::deque<int> model;
+	std::vector<int> in, out;
+	int next{0};
+	auto initial_capacity = cb.capacity();
+	auto overwrite = false;
+	auto growth_limit = 0;
+	std::uint64_t dropped = cb.dropped_units();
+
+	auto fill = [&](int count) {
+		in.resize(static_cast<std::size_t>(count));
+		for (auto& unit : in)
+			unit = next++;
+	};
+	// checks and removes the first count units of the model against what was read
+	auto matches = [&](const int* data, int count) {
+		for (auto i = 0; i < count; ++i)
+		{
+			if (data[i] != model.front())
+				return false;
+			model.pop_front();
+		}
+		return true;
+	};
+
+	for (std::size_t i = 0; i + 1 < size; i += 2)
+	{
+		auto capacity = cb.capacity();
+		auto reach = std::max(capacity, growth_limit);
+		auto count = ops[i + 1] % (reach + 2);
+		auto used = static_cast<int>(model.size());
+		auto free = capacity - used;
+		// the least capacity the buffer may be left with
+		auto required = capacity;
+
+		// reports whether the buffer takes an insertion of count units from in, which is
+		// appended to the model if so: it fits, or the buffer grows to fit it, or (if
+		// overwriting) the oldest units make way, after growing as far as the limit allows.
+		// If trimmed, an insertion larger than that keeps only its newest units.
+		auto inserted = [&](int unit_count, bool trimmed) {
+			auto kept = unit_count;
+			if (unit_count > free && used + unit_count <= growth_limit)
+				required = used + unit_count;
+			else if (unit_count > free)
+			{
+				if (!overwrite)
+					return false;
+				if (trimmed && kept > reach)
+					kept = reach;
+				if (kept > reach)
+					return false;
+				dropped += static_cast<std::uint64_t>(unit_count - kept);
+				required = std::max(capacity, std::min(used + kept, reach));
+			}
+			model.insert(model.end(), in.end() - kept, in.end());
+			return true;
+		};
+
+		switch (ops[i] % 16)
+		{
+			case 0: // insert_units
+				fill(count);
+				if (cb.insert_units(in.data(), count) != inserted(count, true))
+					return false;
+				break;
+
+			case 1: // extract_units
+				out.resize(static_cast<std::size_t>(count));
+				if (cb.extract_units(out.data(), count) != (count <= used))
+					return false;
+				if (count <= used && !matches(out.data(), count))
+					return false;
+				break;
+
+			case 2: // insert_some, which only grows the buffer while it overwrites
+			{
+				fill(count);
+				auto expected = std::min(count, free);
+				if (overwrite)
+					expected = (count && inserted(count, true)) ? count : 0;
+				else
+					model.insert(model.end(), in.begin(), in.begin() + expected);
+				if (cb.insert_some(in.data(), count) != expected)
+					return false;
+				break;
+			}
+
+			case 3: // extract_some
+			{
+				out.resize(static_cast<std::size_t>(count));
+				auto expected = std::min(count, used);
+				if (cb.extract_some(out.data(), count) != expected || !matches(out.data(), expected))
+					return false;
+				break;
+			}
+
+			case 4: // insert_units_v, split into two segments, which is never trimmed
+			{
+				fill(count);
+				const typename Buffer::template Span<const int> segments[] = {
+					{in.data(), count / 2},
+					{in.data() + count / 2, count - count / 2},
+				};
+				if (cb.insert_units_v(segments, 2) != inserted(count, false))
+					return false;
+				break;
+			}
+
+			case 5: // reserve_write + commit_write, which never grow or overwrite
+			{
+				fill(count);
+				auto spans = cb.reserve_write(count);
+				auto expected = std::min(count, free);
+				if (spans.count() != expected || (cb.is_mirrored() && spans.second.count))
+					return false;
+				std::copy_n(in.data(), spans.first.count, spans.first.data);
+				std::copy_n(in.data() + spans.first.count, spans.second.count, spans.second.data);
+				if (!cb.commit_write(expected))
+					return false;
+				model.insert(model.end(), in.begin(), in.begin() + expected);
+				break;
+			}
+
+			case 6: // peek_read + consume
+			{
+				auto spans = cb.peek_read(count);
+				auto expected = std::min(count, used);
+				if (spans.count() != expected || (cb.is_mirrored() && spans.second.count))
+					return false;
+				if (!matches(spans.first.data, spans.first.count) || !matches(spans.second.data, spans.second.count))
+					return false;
+				if (!cb.consume(expected))
+					return false;
+				break;
+			}
+
+			case 7: // reserve
+				if constexpr ((Features & model_resize) != 0)
+				{
+					if (!cb.reserve(count))
+						return false;
+					required = std::max(count, capacity);
+				}
+				break;
+
+			case 8: // shrink_to_fit, never below one unit
+				if constexpr ((Features & model_resize) != 0)
+				{
+					auto target = std::max(used, count / 2 + 1);
+					if (!cb.shrink_to_fit(count / 2 + 1))
+						return false;
+					if (cb.capacity() > std::max(target, capacity) || (!cb.is_mirrored() && target < capacity && cb.capacity() != target))
+						return false;
+					required = std::min(target, capacity);
+				}
+				break;
+
+			case 9: // drain, in at most two runs (one when mirrored)
+			{
+				auto expected = std::min(count, used);
+				auto runs = 0;
+				auto seen = true;
+				auto drained = cb.drain(count, [&](const int* data, int unit_count) {
+					++runs;
+					seen = seen && unit_count > 0 && matches(data, unit_count);
+				});
+				if (drained != expected || !seen || runs > (cb.is_mirrored() ? 1 : 2) || (expected && !runs))
+					return false;
+				break;
+			}
+
+			case 10: // discard, or discard_all at the largest count
+			{
+				auto expected = std::min(count, used);
+				if ((count == reach + 1 ? cb.discard_all() : cb.discard(count)) != expected)
+					return false;
+				model.erase(model.begin(), model.begin() + expected);
+				break;
+			}
+
+			case 11: // skip_until the next multiple of count + 1
+			{
+				auto is_marker = [&](int unit) noexcept { return unit % (count + 1) == 0; };
+				auto expected = static_cast<int>(std::find_if(model.begin(), model.end(), is_marker) - model.begin());
+				if (cb.skip_until([&](const int& unit) noexcept { return is_marker(unit); }) != expected)
+					return false;
+				model.erase(model.begin(), model.begin() + expected);
+				break;
+			}
+
+			default: // occasionally start over, with new settings
+				if (count == 0)
+				{
+					cb.reset();
+					model.clear();
+					if constexpr ((Features & model_overwrite) != 0)
+					{
+						overwrite = (ops[i] & 0x10) != 0;
+						cb.set_overwrite_oldest(overwrite);
+						// reset() discards lapped units the consumer never reached, uncounted
+						dropped = cb.dropped_units();
+					}
+					if constexpr ((Features & model_growth) != 0)
+					{
+						growth_limit = (ops[i] & 0x20) ? initial_capacity * 4 : 0;
+						cb.set_growth_limit(growth_limit);
+					}
+				}
+				break;
+		}
+
+		if (cb.capacity() < required)
+			return false;
+		capacity = cb.capacity();
+		// an overwriting insertion drops the oldest units it displaces
+		if (overwrite)
+		{
+			for (; static_cast<int>(model.size()) > capacity; ++dropped)
+				model.pop_front();
+		}
+
+		// an SPSC consumer counts lapped units only once it reaches them, and stops being
+		// lapped as soon as it reads
+		if (cb.dropped_units() > dropped || (cb.dropped_units() != dropped && static_cast<int>(model.size()) < capacity))
+			return false;
+		if (cb.used_space() != static_cast<int>(model.size()) || cb.free_space() != capacity - static_cast<int>(model.size()))
+			return false;
+	}
+
+	return true;
+}
+
+// runs the model check over every buffer flavour, sized so the wrap point moves constantly
+bool check_all_modes(const uint8_t* ops, std::size_t size)
+{
+	CircularBuffer<int> locked(7);
+	CircularBuffer<int, BufferMode::SPSC> spsc(7);
+	CircularBuffer<int, BufferMode::Locked, 8> locked_fixed;
+	CircularBuffer<int, BufferMode::SPSC, 8> spsc_fixed;
+	// double-mapped storage is rounded up to whole pages (or falls back to the heap)
+	CircularBuffer<int> locked_mirrored(7, BufferBacking::Mirrored);
+	CircularBuffer<int, BufferMode::SPSC> spsc_mirrored(7, BufferBacking::Mirrored);
+
+	return check_against_model<model_overwrite | model_growth | model_resize>(locked, ops, size) &&
+		check_against_model<model_resize>(spsc, ops, size) &&
+		check_against_model<model_overwrite>(locked_fixed, ops, size) &&
+		check_against_model<model_overwrite>(spsc_fixed, ops, size) &&
+		check_against_model<model_overwrite | model_growth | model_resize>(locked_mirrored, ops, size) &&
+		check_against_model<model_resize>(spsc_mirrored, ops, size);
+}
+
+#ifdef CIRCULARBUFFER_FUZZ
+// libFuzzer entry point; build with -DCIRCULARBUFFER_FUZZ -fsanitize=fuzzer,address,undefined
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size)
+{
+	if (!check_all_modes(data, size))
+		__builtin_trap();
+	return 0;
+}
+#else
 int main(int argc, char* argv[])
 {
+	// check random operation streams against the reference model before timing anything
+	std::mt19937 ops_mt(12345);
+	std::vector<uint8_t> ops(20000);
+	for (auto pass = 0; pass < 50; ++pass)
+	{
+		for (auto& op : ops)
+			op = static_cast<uint8_t>(ops_mt());
+		if (!check_all_modes(ops.data(), ops.size()))
+		{
+			std::cout << "model check failed on pass " << pass << std::endl;
+			return 1;
+		}
+	}
+
 	// allocate twice our expected storage size
 	auto max = 75000;
 	auto cb_units = 500000;
@@ -157,3 +405,4 @@ int main(int argc, char* argv[])
 	auto millis = run_circular_buffer_test(cb, max, 50000);
 	std::cout << millis << " ms" << std::endl;
 }
+#endif